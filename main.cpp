@@ -10,27 +10,32 @@ using namespace glm;
 #include "common/shader.hpp"
 #include "setup/setup.cpp" //functions for setting up window initializing glew and so on
 #include "mesh_and_drawing/mesh.cpp"
+#include "mesh_and_drawing/lights.cpp" //light maps, needs mesh.cpp above
 
 #include <vector>
 #include <cmath>
 
+// Width of the ray lines in pixels
+const GLfloat rayLineWidth = 2.0f;
+
 // For measuring frames
 double lastTime = glfwGetTime();
 int nbFrames = 0;
 
 // Function for the main rendering loop
 void renderLoop(GLFWwindow* window,
+GLuint programID,
+AALineProgram& lineProgram,
+LightAccumulation& lights,
 std::vector<DrawDetails> ourDrawDetails,
 std::vector<DrawDetails> ourLineDrawDetails,
-std::vector<RaysData> MyRays,
+std::vector<RaysData>& MyRays,
 std::vector<WallsData> wallsData) {
     // Init cursor position
     double xpos, ypos;
     glfwGetCursorPos(window, &xpos, &ypos);
     GLfloat x = static_cast<GLfloat>((2.0 * xpos) / 1000.0 - 1.0);  // Transform to the range [-1, 1] for X
     GLfloat y = static_cast<GLfloat>(1.0 - (2.0 * ypos) / 1000.0);  // Transform to the range [-1, 1] for Y
-    GLfloat lastX = 0.0f;
-    GLfloat lastY = 0.0f;
 
     while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && !glfwWindowShouldClose(window)) {
         // Measure frames
@@ -44,6 +49,10 @@ std::vector<WallsData> wallsData) {
             lastTime += 1.0;
         }
 
+        // Real pixel size, can differ from the window size on high-DPI displays
+        int fbWidth, fbHeight;
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
         // Rotate points by 10 degrees on LMB
@@ -51,23 +60,35 @@ std::vector<WallsData> wallsData) {
         rotateRays(window, oldState, MyRays[0].LineposData);
 
         //Move rays to mouse position
-        moveRays(window, MyRays[0].LineposData, lastX, lastY);
-        ourLineDrawDetails.clear();
-        ourLineDrawDetails.push_back(UploadRayMesh(
-            MyRays[0].LineposData, // points
-            MyRays[0].LinecolorData, // colors at points
-            MyRays[0].LineElems // indices
-        ));
-
+        moveRays(window, MyRays[0]);
 
         //check if ray is colliding with wall and change its length
-        doThatCollisionStuff(MyRays, wallsData, ourLineDrawDetails);
+        //only dynamic lights and static lights with a stale light map get recomputed
+        doThatCollisionStuff(MyRays, wallsData);
+
+        //rasterize all lights into the offscreen accumulation texture
+        UpdateLightMaps(lights, MyRays, programID);
 
         //make dynamic walls creation
         //add lines as walls
+        //addObjectAsToWalls re-bakes the cached light maps
 
+        glViewport(0, 0, fbWidth, fbHeight);
+        glUseProgram(programID);
         Draw(ourDrawDetails);
-        DrawLines(ourLineDrawDetails);
+        CompositeLights(lights, fbWidth, fbHeight);
+
+        //only the dynamic lights show their rays
+        for (auto& ray : MyRays) {
+            if (ray.isDynamic) {
+                ourLineDrawDetails.push_back(UploadAALineMesh(
+                    ray.LineposData, // points
+                    ray.LinecolorData, // colors at points
+                    ray.LineElems // indices
+                ));
+            }
+        }
+        DrawAALines(ourLineDrawDetails, lineProgram, rayLineWidth, fbWidth, fbHeight);
 
         //needed becouse changed data in VAO and am 2 stupid to do better for now
         UnloadMesh(ourLineDrawDetails);
@@ -89,6 +110,12 @@ int main() {
     // Create and compile our GLSL program from the shaders
     GLuint programID = LoadShaders("SimpleVertexShader.vertexshader", "SimpleFragmentShader.fragmentshader");
     glUseProgram(programID);
+    // Anti-aliased rays are done analytically in this shader, so no MSAA needed
+    AALineProgram lineProgram = InitAALineProgram(
+        LoadShaders("AALineVertexShader.vertexshader", "AALineFragmentShader.fragmentshader"));
+
+    //Lights, filled in below, walls flag them for re-baking
+    std::vector<RaysData> MyRays;
 
     //Setting up walls data
     std::vector<DrawDetails> ourDrawDetails;
@@ -106,7 +133,7 @@ int main() {
         0.5f, 0.5f, 0.5f,
     };
     GLuint elems[] = {0, 1, 2};
-    addObjectAsToWalls(ourDrawDetails, wallsData, posData, colorData, elems,
+    addObjectAsToWalls(ourDrawDetails, wallsData, MyRays, posData, colorData, elems,
                    sizeof(posData) / sizeof(posData[0]),
                    sizeof(colorData) / sizeof(colorData[0]),
                    sizeof(elems) / sizeof(elems[0]));
@@ -123,7 +150,7 @@ int main() {
         0.5f, 0.5f, 0.5f,
     };
     GLuint elems[] = {0, 1, 2};
-    addObjectAsToWalls(ourDrawDetails, wallsData, posData, colorData, elems,
+    addObjectAsToWalls(ourDrawDetails, wallsData, MyRays, posData, colorData, elems,
                    sizeof(posData) / sizeof(posData[0]),
                    sizeof(colorData) / sizeof(colorData[0]),
                    sizeof(elems) / sizeof(elems[0]));
@@ -140,7 +167,7 @@ int main() {
         0.5f, 0.5f, 0.5f,
     };
     GLuint elems[] = {0, 1, 2};
-    addObjectAsToWalls(ourDrawDetails, wallsData, posData, colorData, elems,
+    addObjectAsToWalls(ourDrawDetails, wallsData, MyRays, posData, colorData, elems,
                    sizeof(posData) / sizeof(posData[0]),
                    sizeof(colorData) / sizeof(colorData[0]),
                    sizeof(elems) / sizeof(elems[0]));
@@ -148,55 +175,37 @@ int main() {
 
     //Setting up lines data
     std::vector<DrawDetails> ourLineDrawDetails;
-    GLfloat x = 0.0f;
-    GLfloat y = 0.0f;
-    // Set up base rays
-    const int rayCount = 90;
-    GLfloat baseRayLenght = 1.0f;  
-    std::vector<GLfloat> LineposData = {
-        x,y,
-    };
-    std::vector<GLfloat>  LinecolorData = {
-        1.0f, 1.0f, 1.0f,
-    };
-    std::vector<GLuint>  LineElems = {};//indices for keeping it optimized
-    for (int i = 0; i <= rayCount; i ++) {
-        GLfloat nextX = x + baseRayLenght * cos(i * 90.0f / rayCount * 3.14159265359f / 180.0f);  // Calculate the x-coordinate
-        GLfloat nextY = y + baseRayLenght * sin(i * 90.0f / rayCount * 3.14159265359f / 180.0f);  // Calculate the y-coordinate
-        // Define the new vertices for the line
-        LineposData.push_back(nextX);
-        LineposData.push_back(nextY);
-
-        LinecolorData.insert(LinecolorData.end(), {1.0f, 1.0f, 1.0f});
-
-        LineElems.push_back(0);
-        LineElems.push_back(i+1);
+    // Set up base rays, the first emitter follows the cursor
+    MyRays.push_back(makeEmitter(0.0f, 0.0f, 90, 90.0f, 1.0f, 1.0f, 1.0f, 1.0f, true));
+
+    // Grid of static lights, these get baked once into cached light maps
+    const int staticLightsPerSide = 16;
+    for (int i = 0; i < staticLightsPerSide; i++) {
+        for (int j = 0; j < staticLightsPerSide; j++) {
+            GLfloat lightX = -0.9f + 1.8f * i / (staticLightsPerSide - 1);
+            GLfloat lightY = -0.9f + 1.8f * j / (staticLightsPerSide - 1);
+            MyRays.push_back(makeEmitter(lightX, lightY, 180, 360.0f, 0.25f,
+                0.15f * i / staticLightsPerSide, 0.05f, 0.15f * j / staticLightsPerSide));
+        }
     }
-    std::vector<RaysData> MyRays;
-    MyRays.push_back(RaysData(LineposData, LinecolorData, LineElems));
-    ourLineDrawDetails.push_back(UploadRayMesh(
-        MyRays[0].LineposData, // points
-        MyRays[0].LinecolorData, // colors at points
-        MyRays[0].LineElems // indices
-        ));
+
+    const int lightMapSize = 512;
+    LightAccumulation lights = InitLightAccumulation(MyRays, lightMapSize);
 
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    glLineWidth(0.5f);
-    glEnable(GL_LINE_SMOOTH);
-    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
     glEnable(GL_DEPTH_TEST);
-    glLineWidth(2);
 
-    glfwWindowHint(GLFW_SAMPLES, 16);
-    glEnable(GL_MULTISAMPLE);  
-    
     // Rendering loop
-    renderLoop(window, ourDrawDetails, ourLineDrawDetails, MyRays, wallsData);
+    renderLoop(window, programID, lineProgram, lights, ourDrawDetails, ourLineDrawDetails, MyRays, wallsData);
 
     // UnloadMesh here
+    UnloadLightAccumulation(lights, MyRays);
     UnloadMesh(ourDrawDetails);
     UnloadMesh(ourLineDrawDetails);
 
+    glDeleteProgram(lineProgram.programID);
+    glDeleteProgram(programID);
+
     glfwTerminate();
     return 0;
 }
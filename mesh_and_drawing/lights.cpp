@@ -0,0 +1,209 @@
+#include <GL/glew.h>
+#include <vector>
+#include <cstdio>
+#include "../common/shader.hpp"
+
+// Offscreen texture lights get rasterized into
+struct LightMapTarget {
+    GLuint FBO = 0;
+    GLuint texture = 0;
+};
+
+struct LightAccumulation {
+    GLuint compositeProgramID = 0;
+    GLint tintLocation = -1;
+    int size = 0; // light maps are size x size, independent of the window
+    std::vector<DrawDetails> quad; // fullscreen quad for sampling light maps
+    LightMapTarget staticAccum; // sum of all cached static light maps
+    LightMapTarget frameAccum; // static sum + dynamic lights of this frame
+    bool staticDirty = true;
+};
+
+static LightMapTarget CreateLightMapTarget(int size, GLenum internalFormat) {
+    LightMapTarget target;
+    // Single channel maps only hold intensity, the light color is applied when accumulating
+    bool singleChannel = (internalFormat == GL_R8);
+
+    glGenTextures(1, &target.texture);
+    glBindTexture(GL_TEXTURE_2D, target.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size, size, 0,
+                 singleChannel ? GL_RED : GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (singleChannel) {
+        // Sample as grey so the composite shader does not care about the format
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &target.FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Light map framebuffer is not complete\n");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return target;
+}
+
+static void DeleteLightMapTarget(GLuint& FBO, GLuint& texture) {
+    glDeleteFramebuffers(1, &FBO);
+    glDeleteTextures(1, &texture);
+    FBO = 0;
+    texture = 0;
+}
+
+// Triangle fan from the emitter through the ray ends, i.e. the area the light can see.
+// Colors fade out along each ray so overlapping lights blend nicely.
+static DrawDetails UploadLightFanMesh(RaysData& ray, GLfloat r, GLfloat g, GLfloat b) {
+    GLuint pointCount = static_cast<GLuint>(ray.LineposData.size() / 2);
+    std::vector<GLfloat> colors = {r, g, b};
+    std::vector<GLuint> elems;
+    for (GLuint i = 1; i < pointCount; i++) {
+        Point start = {ray.LineposData[0], ray.LineposData[1]};
+        Point end = {ray.LineposData[2 * i], ray.LineposData[2 * i + 1]};
+        GLfloat falloff = 1.0f - distance(start, end) / ray.rayLength;
+        if (falloff < 0.0f) falloff = 0.0f;
+        colors.insert(colors.end(), {r * falloff, g * falloff, b * falloff});
+        if (i + 1 < pointCount) {
+            elems.insert(elems.end(), {0, i, i + 1});
+        }
+    }
+    if (ray.fullCircle && pointCount > 2) {
+        // Close the gap between the last and the first ray
+        elems.insert(elems.end(), {0, pointCount - 1, 1});
+    }
+    return UploadRayMesh(ray.LineposData, colors, elems);
+}
+
+static void DrawLightFan(RaysData& ray, GLfloat r, GLfloat g, GLfloat b) {
+    std::vector<DrawDetails> fan;
+    fan.push_back(UploadLightFanMesh(ray, r, g, b));
+    Draw(fan);
+    UnloadMesh(fan);
+}
+
+static void DrawLightMap(LightAccumulation& lights, GLuint texture, GLfloat r, GLfloat g, GLfloat b) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glUniform3f(lights.tintLocation, r, g, b);
+    Draw(lights.quad);
+}
+
+static LightAccumulation InitLightAccumulation(std::vector<RaysData>& MyRays, int size) {
+    LightAccumulation lights;
+    lights.size = size;
+    lights.compositeProgramID = LoadShaders("LightCompositeVertexShader.vertexshader", "LightCompositeFragmentShader.fragmentshader");
+    glUseProgram(lights.compositeProgramID);
+    glUniform1i(glGetUniformLocation(lights.compositeProgramID, "lightMap"), 0);
+    lights.tintLocation = glGetUniformLocation(lights.compositeProgramID, "tint");
+
+    std::vector<GLfloat> quadPos = {-1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f};
+    std::vector<GLfloat> quadColors(12, 1.0f);
+    std::vector<GLuint> quadElems = {0, 1, 2, 0, 2, 3};
+    lights.quad.push_back(UploadRayMesh(quadPos, quadColors, quadElems));
+
+    // Half float so hundreds of lights can add up without clipping
+    lights.staticAccum = CreateLightMapTarget(size, GL_RGBA16F);
+    lights.frameAccum = CreateLightMapTarget(size, GL_RGBA16F);
+
+    for (auto& ray : MyRays) {
+        if (ray.isDynamic) {
+            continue;
+        }
+        LightMapTarget target = CreateLightMapTarget(size, GL_R8);
+        ray.lightFBO = target.FBO;
+        ray.lightTexture = target.texture;
+        ray.needsBake = true;
+    }
+    return lights;
+}
+
+// Needs doThatCollisionStuff to have run first so baked and dynamic lights are up to date.
+// Leaves the viewport at the light map size, the caller sets its own afterwards.
+static void UpdateLightMaps(LightAccumulation& lights, std::vector<RaysData>& MyRays, GLuint programID) {
+    glViewport(0, 0, lights.size, lights.size);
+    glDisable(GL_DEPTH_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+    // Re-bake only static lights that moved since their map was cached
+    glUseProgram(programID);
+    glDisable(GL_BLEND);
+    for (auto& ray : MyRays) {
+        if (ray.isDynamic || !ray.needsBake) {
+            continue;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, ray.lightFBO);
+        glClear(GL_COLOR_BUFFER_BIT);
+        DrawLightFan(ray, 1.0f, 1.0f, 1.0f);
+        ray.needsBake = false;
+        lights.staticDirty = true;
+    }
+
+    glUseProgram(lights.compositeProgramID);
+    glActiveTexture(GL_TEXTURE0);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    // Sum the cached maps, this only happens when one of them changed
+    if (lights.staticDirty) {
+        glBindFramebuffer(GL_FRAMEBUFFER, lights.staticAccum.FBO);
+        glClear(GL_COLOR_BUFFER_BIT);
+        for (auto& ray : MyRays) {
+            if (ray.isDynamic) {
+                continue;
+            }
+            DrawLightMap(lights, ray.lightTexture,
+                         ray.LinecolorData[0], ray.LinecolorData[1], ray.LinecolorData[2]);
+        }
+        lights.staticDirty = false;
+    }
+
+    // This frame = cached static sum + dynamic lights drawn straight in
+    glBindFramebuffer(GL_FRAMEBUFFER, lights.frameAccum.FBO);
+    glClear(GL_COLOR_BUFFER_BIT);
+    DrawLightMap(lights, lights.staticAccum.texture, 1.0f, 1.0f, 1.0f);
+
+    glUseProgram(programID);
+    for (auto& ray : MyRays) {
+        if (!ray.isDynamic) {
+            continue;
+        }
+        DrawLightFan(ray, ray.LinecolorData[0], ray.LinecolorData[1], ray.LinecolorData[2]);
+    }
+
+    glDisable(GL_BLEND);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+// Adds the accumulated light on top of whatever is in the window framebuffer
+static void CompositeLights(LightAccumulation& lights, int width, int height) {
+    glViewport(0, 0, width, height);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    glUseProgram(lights.compositeProgramID);
+    glActiveTexture(GL_TEXTURE0);
+    DrawLightMap(lights, lights.frameAccum.texture, 1.0f, 1.0f, 1.0f);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+}
+
+static void UnloadLightAccumulation(LightAccumulation& lights, std::vector<RaysData>& MyRays) {
+    for (auto& ray : MyRays) {
+        if (ray.lightFBO != 0) {
+            DeleteLightMapTarget(ray.lightFBO, ray.lightTexture);
+        }
+    }
+    DeleteLightMapTarget(lights.staticAccum.FBO, lights.staticAccum.texture);
+    DeleteLightMapTarget(lights.frameAccum.FBO, lights.frameAccum.texture);
+    UnloadMesh(lights.quad);
+    glDeleteProgram(lights.compositeProgramID);
+}
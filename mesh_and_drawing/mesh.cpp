@@ -4,25 +4,89 @@
 #include "fun.cpp" // and by fun i mean math stuff
 
 struct DrawDetails {
-    DrawDetails(GLuint v, GLuint e) {
+    DrawDetails(GLuint v, GLuint e, GLuint b0 = 0, GLuint b1 = 0, GLuint b2 = 0) {
         VAO = v;
         numElements = e;
+        buffers[0] = b0;
+        buffers[1] = b1;
+        buffers[2] = b2;
     }
     GLuint VAO = 0;
     GLuint numElements = 0;
+    GLuint numInstances = 0; // only for instanced meshes, one instance per line segment
+    GLuint buffers[3] = {0, 0, 0}; // buffers the VAO uses, deleted with it in UnloadMesh
 };
 
 struct RaysData{
-    RaysData(std::vector<GLfloat> podData, std::vector<GLfloat> colorData, std::vector<GLuint> Elems){
+    RaysData(std::vector<GLfloat> podData, std::vector<GLfloat> colorData, std::vector<GLuint> Elems,
+             GLfloat length = 1.0f, bool dynamic = false){
         LineposData = podData;
         LineElems = Elems;
         LinecolorData = colorData;
+        rayLength = length;
+        isDynamic = dynamic;
     }
     std::vector<GLfloat> LineposData = {};
-    std::vector<GLfloat>  LinecolorData = {};
+    std::vector<GLfloat>  LinecolorData = {}; // first color is the color of the light itself
     std::vector<GLuint>  LineElems = {};
+    GLfloat rayLength = 1.0f;
+    bool fullCircle = false; // rays go all the way round, the last one is next to the first
+    bool isDynamic = false; // moves around so its light is recomputed every frame
+    bool needsBake = true; // static light whose cached light map is out of date
+    GLuint lightFBO = 0;
+    GLuint lightTexture = 0;
 };
 
+// Builds an emitter at (x, y) with rayCount + 1 rays spread over spreadDegrees.
+// A 360 degree emitter gets only rayCount rays, the extra one would repeat the first.
+static RaysData makeEmitter(GLfloat x, GLfloat y, int rayCount, GLfloat spreadDegrees, GLfloat rayLength,
+                            GLfloat r, GLfloat g, GLfloat b, bool dynamic = false) {
+    std::vector<GLfloat> LineposData = {
+        x,y,
+    };
+    std::vector<GLfloat>  LinecolorData = {
+        r, g, b,
+    };
+    std::vector<GLuint>  LineElems = {};//indices for keeping it optimized
+    bool fullCircle = spreadDegrees >= 360.0f;
+    int lastRay = fullCircle ? rayCount - 1 : rayCount;
+    for (int i = 0; i <= lastRay; i ++) {
+        GLfloat angle = i * spreadDegrees / rayCount * 3.14159265359f / 180.0f;
+        LineposData.push_back(x + rayLength * cos(angle));  // Calculate the x-coordinate
+        LineposData.push_back(y + rayLength * sin(angle));  // Calculate the y-coordinate
+
+        LinecolorData.insert(LinecolorData.end(), {r, g, b});
+
+        LineElems.push_back(0);
+        LineElems.push_back(i+1);
+    }
+    RaysData emitter(LineposData, LinecolorData, LineElems, rayLength, dynamic);
+    emitter.fullCircle = fullCircle;
+    return emitter;
+}
+
+// Moves the whole emitter to (x, y), a static one gets its light map re-baked
+static void MoveEmitter(RaysData& ray, GLfloat x, GLfloat y) {
+    GLfloat deltaX = x - ray.LineposData[0];
+    GLfloat deltaY = y - ray.LineposData[1];
+    for (size_t i = 0; i < ray.LineposData.size(); i += 2) {
+        ray.LineposData[i] += deltaX;
+        ray.LineposData[i + 1] += deltaY;
+    }
+    if (!ray.isDynamic) {
+        ray.needsBake = true;
+    }
+}
+
+// Walls changed, every cached light map may be shadowed differently now
+static void InvalidateStaticLights(std::vector<RaysData>& MyRays) {
+    for (auto& ray : MyRays) {
+        if (!ray.isDynamic) {
+            ray.needsBake = true;
+        }
+    }
+}
+
 struct WallsData {
     WallsData(GLfloat* pos, GLfloat* cD, GLuint* Elems, size_t posSize, size_t cDSize, size_t elemsSize) {
         posData.assign(pos, pos + posSize);
@@ -69,7 +133,7 @@ static DrawDetails UploadMesh(GLfloat* verts, GLfloat* colors, int v_count, GLui
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elemHandle);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, e_count * sizeof(GLuint), elems, GL_STATIC_DRAW);
 
-    return DrawDetails(vaoHandle, static_cast<uint32_t>(e_count));
+    return DrawDetails(vaoHandle, static_cast<uint32_t>(e_count), posBufferHandle, colorBufferHandle, elemHandle);
 }
 
 static DrawDetails UploadRayMesh(
@@ -115,11 +179,13 @@ static DrawDetails UploadRayMesh(
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elemHandle);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, elems.size() * sizeof(GLuint), elems.data(), GL_STATIC_DRAW);
 
-    return DrawDetails(vaoHandle, static_cast<uint32_t>(elems.size()));
+    return DrawDetails(vaoHandle, static_cast<uint32_t>(elems.size()), posBufferHandle, colorBufferHandle, elemHandle);
 }
 
 static void UnloadMesh(std::vector<DrawDetails>& details) {
     for (const auto& d : details) {
+        // Free the buffers too, meshes are reuploaded every frame (0 is ignored)
+        glDeleteBuffers(3, d.buffers);
         glDeleteVertexArrays(1, &d.VAO);
     }
     details.clear();
@@ -133,35 +199,96 @@ static void Draw(std::vector<DrawDetails>& drawDetails) {
     glBindVertexArray(0);
 }
 
-static void DrawLines(std::vector<DrawDetails>& drawDetails) {
+// Packs every line segment (pair of elems) into one instance: start, end, start color, end color.
+// The AA line shader expands each instance into a quad, so there is no element buffer.
+static DrawDetails UploadAALineMesh(
+    std::vector<GLfloat>& verts,
+    std::vector<GLfloat>& colors,
+    std::vector<GLuint>& elems) {
+
+    std::vector<GLfloat> segments;
+    segments.reserve(elems.size() / 2 * 10);
+    for (size_t i = 0; i + 1 < elems.size(); i += 2) {
+        GLuint a = elems[i];
+        GLuint b = elems[i + 1];
+        segments.insert(segments.end(), {verts[2 * a], verts[2 * a + 1], verts[2 * b], verts[2 * b + 1]});
+        segments.insert(segments.end(), {colors[3 * a], colors[3 * a + 1], colors[3 * a + 2]});
+        segments.insert(segments.end(), {colors[3 * b], colors[3 * b + 1], colors[3 * b + 2]});
+    }
+
+    GLuint segmentBufferHandle;
+    glGenBuffers(1, &segmentBufferHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, segmentBufferHandle);
+    glBufferData(GL_ARRAY_BUFFER, segments.size() * sizeof(GLfloat), segments.data(), GL_STATIC_DRAW);
+
+    // Create and setup vertex array object
+    GLuint vaoHandle;
+    glGenVertexArrays(1, &vaoHandle);
+    glBindVertexArray(vaoHandle);
+
+    // One segment per instance instead of per vertex
+    glBindVertexBuffer(0, segmentBufferHandle, 0, sizeof(GLfloat) * 10);
+    glVertexBindingDivisor(0, 1);
+
+    const GLuint sizes[] = {2, 2, 3, 3};
+    GLuint offset = 0;
+    for (GLuint attrib = 0; attrib < 4; attrib++) {
+        glEnableVertexAttribArray(attrib);
+        glVertexAttribFormat(attrib, sizes[attrib], GL_FLOAT, GL_FALSE, offset * sizeof(GLfloat));
+        glVertexAttribBinding(attrib, 0);
+        offset += sizes[attrib];
+    }
+    glBindVertexArray(0);
+
+    DrawDetails details(vaoHandle, 0, segmentBufferHandle);
+    details.numInstances = static_cast<uint32_t>(elems.size() / 2);
+    return details;
+}
+
+struct AALineProgram {
+    GLuint programID = 0;
+    GLint viewportSizeLocation = -1;
+    GLint lineWidthLocation = -1;
+};
+
+static AALineProgram InitAALineProgram(GLuint programID) {
+    AALineProgram lineProgram;
+    lineProgram.programID = programID;
+    lineProgram.viewportSizeLocation = glGetUniformLocation(programID, "viewportSize");
+    lineProgram.lineWidthLocation = glGetUniformLocation(programID, "lineWidth");
+    return lineProgram;
+}
+
+// Draws meshes from UploadAALineMesh, lineWidth is in pixels of a width x height framebuffer
+static void DrawAALines(std::vector<DrawDetails>& drawDetails, AALineProgram& lineProgram,
+                        GLfloat lineWidth, int width, int height) {
+    glUseProgram(lineProgram.programID);
+    glUniform2f(lineProgram.viewportSizeLocation, (GLfloat)width, (GLfloat)height);
+    glUniform1f(lineProgram.lineWidthLocation, lineWidth);
+
+    // Coverage from the shader goes into alpha. No depth test, the quads of rays
+    // sharing an emitter overlap and one fringe would cut into the next ray.
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     for (const auto& d : drawDetails) {
         glBindVertexArray(d.VAO);
-        glDrawElements(GL_LINES, d.numElements, GL_UNSIGNED_INT, nullptr);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, d.numInstances);
     }
     glBindVertexArray(0);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
 }
 
 
-static void moveRays(GLFWwindow* window, std::vector<GLfloat>& LineposData, GLfloat& lastX, GLfloat& lastY) {
+static void moveRays(GLFWwindow* window, RaysData& ray) {
     // Get cursor position
     double xpos, ypos;
     glfwGetCursorPos(window, &xpos, &ypos);
     GLfloat x = static_cast<GLfloat>((2.0 * xpos) / 1000.0 - 1.0);  // Transform to the range [-1, 1] for X
     GLfloat y = static_cast<GLfloat>(1.0 - (2.0 * ypos) / 1000.0);  // Transform to the range [-1, 1] for Y
-    // Calculate the change in x and y
-    GLfloat deltaX = x - lastX;
-    GLfloat deltaY = y - lastY;
-    // Update the first point of the line segment
-    LineposData[0] = x;
-    LineposData[1] = y;
-    // Move the remaining line segments based on the change in cursor position
-    for (int i = 2; i < LineposData.size(); i += 2) {
-        LineposData[i] += deltaX;
-        LineposData[i + 1] += deltaY;
-    }
-    // Update lastX and lastY for the next iteration
-    lastX = x;
-    lastY = y;
+    // Move the emitter and all its rays to the cursor
+    MoveEmitter(ray, x, y);
 }
 
 static void rotateRays(GLFWwindow* window, int& oldState, std::vector<GLfloat>& LineposData) {
@@ -180,10 +307,13 @@ static void rotateRays(GLFWwindow* window, int& oldState, std::vector<GLfloat>&
 }
 
 static void doThatCollisionStuff(std::vector<RaysData>& MyRays, 
-                                std::vector<WallsData>& wallsData, 
-                                std::vector<DrawDetails>& ourLineDrawDetails){
+                                std::vector<WallsData>& wallsData){
     // here i can calculate and change lenght of rays
     for (auto& ray : MyRays) {
+        // Static lights keep their cached light map, no need to touch them
+        if (!ray.isDynamic && !ray.needsBake) {
+            continue;
+        }
         for (int i = 1; i < (ray.LineposData.size() / 2); ++i) {
             Point currentRayStartPoint = {ray.LineposData[0], ray.LineposData[1]};
             Point currentRayEndPoint = {ray.LineposData[2 * i], ray.LineposData[2 * i + 1]};
@@ -194,9 +324,9 @@ static void doThatCollisionStuff(std::vector<RaysData>& MyRays,
             GLfloat newlength = std::sqrt(dx * dx + dy * dy);
             dx /= newlength;
             dy /= newlength;
-            // Set the endpoints to create a line with a length of 0.5f
-            ray.LineposData[2 * i] = currentRayStartPoint.x + 1.0f * dx;
-            ray.LineposData[2 * i + 1] = currentRayStartPoint.y + 1.0f * dy;
+            // Set the endpoints back to the full length of the ray
+            ray.LineposData[2 * i] = currentRayStartPoint.x + ray.rayLength * dx;
+            ray.LineposData[2 * i + 1] = currentRayStartPoint.y + ray.rayLength * dy;
             for (const auto& wall : wallsData) {
                 for (int j = 0; j < wall.elems.size(); j++) {
                     Point currentRayStartPoint = {ray.LineposData[0], ray.LineposData[1]};
@@ -218,17 +348,11 @@ static void doThatCollisionStuff(std::vector<RaysData>& MyRays,
             }
         }
     }
-    
-    MyRays[0] = RaysData(MyRays[0].LineposData, MyRays[0].LinecolorData, MyRays[0].LineElems);
-        ourLineDrawDetails[0] = UploadRayMesh(
-        MyRays[0].LineposData, // points
-        MyRays[0].LinecolorData, // colors at points
-        MyRays[0].LineElems // indices
-        );
 }
 
 static void addObjectAsToWalls(std::vector<DrawDetails>& ourDrawDetails,
                                 std::vector<WallsData>& wallsData, 
+                                std::vector<RaysData>& MyRays,
                                 GLfloat* addposData,
                                 GLfloat* addcolorData,
                                 GLuint* addelems,
@@ -244,4 +368,7 @@ static void addObjectAsToWalls(std::vector<DrawDetails>& ourDrawDetails,
         posDataSize, // size of array pos
         addelems, // indices
         elemsSize)); // size of array elems
+
+    // New wall can shadow lights that are already baked
+    InvalidateStaticLights(MyRays);
 }
\ No newline at end of file
@@ -7,7 +7,7 @@ int initGLFW() {
         fprintf(stderr, "Failed to initialize GLFW\n");
         return -1;
     }
-    glfwWindowHint(GLFW_SAMPLES, 8); 
+    glfwWindowHint(GLFW_SAMPLES, 0); // No MSAA, lines are anti-aliased in their shader
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); // We want OpenGL 4.3
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // We don't want the old OpenGL